@@ -4,6 +4,8 @@
 /* jordan bonecutter * * * * * * * * * * * * * * * * * * * * * * * * */
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdbool.h>
 #include <assert.h>
@@ -12,9 +14,11 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
+#include "memtools_internal.h"
 #include "memtools_memory_interface.h"
+#include "memtools_trace.h"
+#include "memtools_sites.h"
 
-#define MAGIC_NUMBER 0xEC5EE674CA4A4A96
 #define MEMTOOLS_MEMORY_COMMENT_BUFFER_SIZE 1000
 #define MEMTOOLS_WPRINTF_BUFFER_SIZE        1000
 
@@ -30,6 +34,10 @@ size_t total_allocated_bytes = 0;
 unsigned int n_allocations = 0;
 memtools_memory_interface* memory_interface = NULL;
 
+/* blocks from MEMTOOLS_LEVEL 1 code, updated without the lock */
+size_t counted_bytes = 0;
+size_t n_counted_allocations = 0;
+
 /* mutex lock for multithreaded applications */
 pthread_mutex_t memory_allocations_lock = PTHREAD_MUTEX_INITIALIZER;
 
@@ -42,38 +50,355 @@ void print_wrapped(const char* format, ...){
   va_end(args);
 }
 
-/* check if allocation has been violated by looking at header and footer */
-static bool allocation_has_been_violated(memtools_allocation* allocation){
-  return *((uint64_t*)(allocation->memstart + allocation->n + (allocation->n&0x7))) != MAGIC_NUMBER || *(((uint64_t*)allocation->memstart)-1) != MAGIC_NUMBER;
-}
-
-/* memtools version of malloc */
-void* memtools_malloc(size_t n, unsigned int line, char* file){
+/* add a registry entry for a new n byte block, NULL if there was no memory */
+static uint8_t* add_tracked_allocation(size_t n, unsigned int line, char* file, char* alloc_type,
+                                       memtools_trace_op op, bool canaried){
+  uint8_t* memstart;
   pthread_mutex_lock(&memory_allocations_lock);
 
   /* add more memory for new malloc */
-  memtools_allocation* new = memtools_memory_interface_add_allocation(&memory_interface, n);
+  memtools_allocation* new = memtools_memory_interface_add_allocation(&memory_interface, n,
+                                                                      memtools_site_id(file, line, alloc_type, canaried));
+  if(!new){
+    pthread_mutex_unlock(&memory_allocations_lock);
+    return NULL;
+  }
 
   /* initialize current allocation */
-  new->line = line;
-  new->file = file;
-  new->alloc_type = ALLOC_TYPE_MALLOC;
-  new->comments = NULL;
-  new->n_comments = 0;
+  new->trace_id = memtools_trace_record_op(op, n, 0);
   total_allocated_bytes += n;
   n_allocations += 1;
+  memstart = new->memstart;
+  pthread_mutex_unlock(&memory_allocations_lock);
+
+  return memstart;
+}
+
+/* memtools version of malloc */
+void* memtools_malloc(size_t n, unsigned int line, char* file){
+  return add_tracked_allocation(n, line, file, ALLOC_TYPE_MALLOC, MEMTOOLS_TRACE_MALLOC, true);
+}
+
+/* MEMTOOLS_LEVEL 2 version of malloc, tracked but without canaries */
+void* memtools_registry_malloc(size_t n, unsigned int line, char* file){
+  return add_tracked_allocation(n, line, file, ALLOC_TYPE_MALLOC, MEMTOOLS_TRACE_MALLOC, false);
+}
+
+/* untracked blocks (MEMTOOLS_LEVEL 0 and 1) have no registry entry. Level 0
+ * blocks are plain libc blocks, level 1 blocks have a header in front that
+ * holds their size for the counted totals. */
+typedef struct{
+  size_t n;
+  size_t reserved; /* keeps the block 16 byte aligned like malloc's */
+}untracked_header;
+
+/* addresses of live untracked blocks, one set per level, so free and realloc
+ * from any level know what kind of block they were given before touching
+ * it. Striped so untracked code doesn't contend on the allocation lock or on
+ * each other. */
+#define UNTRACKED_STRIPES 16
+#define UNTRACKED_SET_INITIALIZER {PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0}
+#define UNTRACKED_SETS_INITIALIZER {\
+  UNTRACKED_SET_INITIALIZER, UNTRACKED_SET_INITIALIZER, UNTRACKED_SET_INITIALIZER, UNTRACKED_SET_INITIALIZER,\
+  UNTRACKED_SET_INITIALIZER, UNTRACKED_SET_INITIALIZER, UNTRACKED_SET_INITIALIZER, UNTRACKED_SET_INITIALIZER,\
+  UNTRACKED_SET_INITIALIZER, UNTRACKED_SET_INITIALIZER, UNTRACKED_SET_INITIALIZER, UNTRACKED_SET_INITIALIZER,\
+  UNTRACKED_SET_INITIALIZER, UNTRACKED_SET_INITIALIZER, UNTRACKED_SET_INITIALIZER, UNTRACKED_SET_INITIALIZER,\
+}
+
+typedef struct{
+  pthread_mutex_t lock;
+  void** slots;   /* open addressing, NULL is empty */
+  size_t n, size;
+}untracked_set;
+
+static untracked_set passthrough_blocks[UNTRACKED_STRIPES] = UNTRACKED_SETS_INITIALIZER;
+static untracked_set counted_blocks[UNTRACKED_STRIPES] = UNTRACKED_SETS_INITIALIZER;
+
+static uint64_t hash_pointer(void* ptr){
+  uint64_t h = (uintptr_t)ptr*0x9E3779B97F4A7C15ull;
+  return h ^ (h >> 29);
+}
+
+static untracked_set* set_for_pointer(untracked_set* sets, void* ptr){
+  return sets + (hash_pointer(ptr) & (UNTRACKED_STRIPES - 1));
+}
+
+static size_t home_slot(untracked_set* set, void* ptr){
+  return (hash_pointer(ptr) >> 4) & (set->size - 1);
+}
+
+static void set_insert_locked(untracked_set* set, void* ptr){
+  void** old_slots;
+  size_t i, old_size;
+
+  /* keep the table at most half full */
+  if((set->n + 1)*2 > set->size){
+    old_slots = set->slots;
+    old_size = set->size;
+    set->size = old_size ? old_size*2 : 64;
+    set->slots = calloc(set->size, sizeof *set->slots);
+    set->n = 0;
+    for(i = 0; i < old_size; ++i){
+      if(old_slots[i]){
+        set_insert_locked(set, old_slots[i]);
+      }
+    }
+    free(old_slots);
+  }
+
+  for(i = home_slot(set, ptr); set->slots[i]; i = (i + 1) & (set->size - 1));
+  set->slots[i] = ptr;
+  set->n++;
+}
+
+/* slot holding ptr, or set->size if it isn't there */
+static size_t set_find_locked(untracked_set* set, void* ptr){
+  size_t i;
+
+  if(set->size){
+    for(i = home_slot(set, ptr); set->slots[i]; i = (i + 1) & (set->size - 1)){
+      if(set->slots[i] == ptr){
+        return i;
+      }
+    }
+  }
+  return set->size;
+}
+
+static void untracked_set_insert(untracked_set* sets, void* ptr){
+  untracked_set* set = set_for_pointer(sets, ptr);
+
+  pthread_mutex_lock(&set->lock);
+  set_insert_locked(set, ptr);
+  pthread_mutex_unlock(&set->lock);
+}
+
+static bool untracked_set_contains(untracked_set* sets, void* ptr){
+  untracked_set* set = set_for_pointer(sets, ptr);
+  bool found;
+
+  pthread_mutex_lock(&set->lock);
+  found = set_find_locked(set, ptr) != set->size;
+  pthread_mutex_unlock(&set->lock);
+  return found;
+}
+
+/* remove ptr if it is in the set, returns whether it was */
+static bool untracked_set_remove(untracked_set* sets, void* ptr){
+  untracked_set* set = set_for_pointer(sets, ptr);
+  size_t i, j, home;
+  bool found;
+
+  pthread_mutex_lock(&set->lock);
+  i = set_find_locked(set, ptr);
+  found = i != set->size;
+  if(found){
+    /* shift later entries of the probe run back over the hole */
+    for(j = i;;){
+      j = (j + 1) & (set->size - 1);
+      if(!set->slots[j]){
+        break;
+      }
+      home = home_slot(set, set->slots[j]);
+      if(i <= j ? (i < home && home <= j) : (i < home || home <= j)){
+        continue;
+      }
+      set->slots[i] = set->slots[j];
+      i = j;
+    }
+    set->slots[i] = NULL;
+    set->n--;
+  }
+  pthread_mutex_unlock(&set->lock);
+
+  return found;
+}
+
+static size_t untracked_sets_overhead(untracked_set* sets){
+  untracked_set* set;
+  size_t overhead = 0;
+
+  for(set = sets; set != sets + UNTRACKED_STRIPES; ++set){
+    pthread_mutex_lock(&set->lock);
+    overhead += (sizeof *set->slots)*set->size;
+    pthread_mutex_unlock(&set->lock);
+  }
+  return overhead;
+}
+
+static bool is_untracked_block(void* ptr){
+  return untracked_set_contains(passthrough_blocks, ptr) || untracked_set_contains(counted_blocks, ptr);
+}
+
+/* whether ptr is anywhere in a block memtools handed out */
+static bool is_memtools_block(void* ptr){
+  bool tracked;
+
+  if(is_untracked_block(ptr)){
+    return true;
+  }
+  pthread_mutex_lock(&memory_allocations_lock);
+  tracked = memtools_memory_interface_get_allocation_for_pointer(memory_interface, ptr) != NULL;
   pthread_mutex_unlock(&memory_allocations_lock);
+  return tracked;
+}
+
+static void* passthrough_block(void* ptr){
+  if(ptr){
+    untracked_set_insert(passthrough_blocks, ptr);
+  }
+  return ptr;
+}
+
+/* ptr must already have been taken out of passthrough_blocks */
+static void* passthrough_realloc(void* ptr, size_t n){
+  void* new_ptr = realloc(ptr, n);
+
+  untracked_set_insert(passthrough_blocks, new_ptr ? new_ptr : ptr);
+  return new_ptr;
+}
+
+static void* counted_malloc(size_t n){
+  untracked_header* header;
+
+  if(n > SIZE_MAX - sizeof *header){
+    return NULL;
+  }
+  header = malloc((sizeof *header) + n);
+  if(!header){
+    return NULL;
+  }
+  header->n = n;
+  untracked_set_insert(counted_blocks, header + 1);
+
+  __atomic_add_fetch(&counted_bytes, n, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&n_counted_allocations, 1, __ATOMIC_RELAXED);
+  return header + 1;
+}
+
+/* ptr must already have been taken out of counted_blocks */
+static void* counted_realloc(void* ptr, size_t n){
+  untracked_header* header = (untracked_header*)ptr - 1;
+  size_t old_n = header->n;
+
+  header = n <= SIZE_MAX - sizeof *header ? realloc(header, (sizeof *header) + n) : NULL;
+  if(!header){
+    untracked_set_insert(counted_blocks, ptr);
+    return NULL;
+  }
+  header->n = n;
+  untracked_set_insert(counted_blocks, header + 1);
+
+  __atomic_add_fetch(&counted_bytes, n - old_n, __ATOMIC_RELAXED);
+  return header + 1;
+}
+
+/* ptr must already have been taken out of counted_blocks */
+static void counted_free(void* ptr){
+  untracked_header* header = (untracked_header*)ptr - 1;
+
+  __atomic_sub_fetch(&counted_bytes, header->n, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&n_counted_allocations, 1, __ATOMIC_RELAXED);
+  free(header);
+}
+
+/* MEMTOOLS_LEVEL 0 wrappers, libc plus a set entry so other levels can free
+ * the block. Level 0 code can also free and realloc memory memtools never
+ * saw, like getline()'s buffers, those go straight to libc. */
+void* memtools_passthrough_malloc(size_t n){
+  return passthrough_block(malloc(n));
+}
+
+void* memtools_passthrough_calloc(size_t n, size_t m){
+  return passthrough_block(calloc(n, m));
+}
+
+void* memtools_passthrough_realloc(void* ptr, size_t n, unsigned int line, char* file){
+  if(!ptr){
+    return memtools_passthrough_malloc(n);
+  }
+  if(n && untracked_set_remove(passthrough_blocks, ptr)){
+    return passthrough_realloc(ptr, n);
+  }
+  if(!is_memtools_block(ptr)){
+    return realloc(ptr, n);
+  }
+  return memtools_realloc(ptr, n, line, file);
+}
 
-  return new->memstart;
+void* memtools_passthrough_strdup(char* str){
+  return passthrough_block(strdup(str));
+}
+
+void* memtools_passthrough_strndup(char* str, size_t n){
+  return passthrough_block(strndup(str, n));
+}
+
+void memtools_passthrough_free(void* ptr, unsigned int line, char* file){
+  if(untracked_set_remove(passthrough_blocks, ptr) || (ptr && !is_memtools_block(ptr))){
+    free(ptr);
+    return;
+  }
+  memtools_free(ptr, line, file);
+}
+
+/* MEMTOOLS_LEVEL 1 wrappers, only counted in the totals */
+void* memtools_counted_malloc(size_t n){
+  return counted_malloc(n);
+}
+
+void* memtools_counted_calloc(size_t n, size_t m){
+  void* ptr;
+
+  if(m && n > SIZE_MAX/m){
+    return NULL;
+  }
+  ptr = counted_malloc(n*m);
+  return ptr ? memset(ptr, 0, n*m) : NULL;
+}
+
+void* memtools_counted_realloc(void* ptr, size_t n, unsigned int line, char* file){
+  if(!ptr){
+    return counted_malloc(n);
+  }
+  return memtools_realloc(ptr, n, line, file);
 }
 
-/* add a comment to current memory allocation */
-void memtools_memory_comment(void* ptr, char* fmt, ...){
+static void* counted_strndup(char* str, size_t n){
+  size_t slen;
+  char* dup;
+
+  slen = strlen(str);
+  slen = slen > n ? n : slen;
+  dup = counted_malloc(slen + 1);
+  if(dup){
+    memcpy(dup, str, slen);
+    dup[slen] = '\0';
+  }
+  return dup;
+}
+
+void* memtools_counted_strdup(char* str){
+  return counted_strndup(str, strlen(str));
+}
+
+void* memtools_counted_strndup(char* str, size_t n){
+  return counted_strndup(str, n);
+}
+
+/* add a comment to current memory allocation, untracked blocks have nowhere
+ * to keep one so commenting on them does nothing */
+bool memtools_memory_comment(void* ptr, char* fmt, ...){
   memtools_allocation* curr; 
+  memtools_allocation_extra* extra;
   int n;
   char *buffer;
   va_list args1, args2;
 
+  if(is_untracked_block(ptr)){
+    return false;
+  }
+
   pthread_mutex_lock(&memory_allocations_lock);
   curr = memtools_memory_interface_get_allocation_for_pointer(memory_interface, ptr);
   if(!curr){
@@ -99,16 +424,23 @@ void memtools_memory_comment(void* ptr, char* fmt, ...){
     vsnprintf(buffer, n+1, fmt, args2);
   }
   va_end(args2);
-  curr->n_comments++;
-  curr->comments = realloc(curr->comments, (sizeof *curr->comments)*curr->n_comments);
-  curr->comments[curr->n_comments - 1] = buffer;
+  extra = memtools_memory_interface_get_extra(memory_interface, curr, true);
+  extra->n_comments++;
+  extra->comments = realloc(extra->comments, (sizeof *extra->comments)*extra->n_comments);
+  extra->comments[extra->n_comments - 1] = buffer;
   pthread_mutex_unlock(&memory_allocations_lock);
+  return true;
 }
 
 /* check if ptr is in any of the current allocations */
 bool memtools_is_valid_pointer(void* ptr){
   memtools_allocation* curr; 
 
+  /* untracked blocks are only known by their start */
+  if(is_untracked_block(ptr)){
+    return true;
+  }
+
   pthread_mutex_lock(&memory_allocations_lock);
   curr = memtools_memory_interface_get_allocation_for_pointer(memory_interface, ptr);
   pthread_mutex_unlock(&memory_allocations_lock);
@@ -124,6 +456,11 @@ bool memtools_has_memory_been_violated(void* ptr){
   memtools_allocation* curr; 
   bool has_memory_been_violated;
 
+  /* untracked blocks have no canaries to check */
+  if(is_untracked_block(ptr)){
+    return false;
+  }
+
   pthread_mutex_lock(&memory_allocations_lock);
   curr = memtools_memory_interface_get_allocation_for_pointer(memory_interface, ptr);
   if(!curr){
@@ -131,7 +468,7 @@ bool memtools_has_memory_been_violated(void* ptr){
     exit(0);
   }
 
-  has_memory_been_violated = allocation_has_been_violated(curr);
+  has_memory_been_violated = memtools_memory_interface_allocation_violated(memory_interface, curr);
   pthread_mutex_unlock(&memory_allocations_lock);
 
   return has_memory_been_violated;
@@ -139,25 +476,114 @@ bool memtools_has_memory_been_violated(void* ptr){
 
 /* print memtools_allocation struct */
 static void print_allocation(memtools_allocation* allocation){
+  memtools_site* site = memtools_site_get(allocation->site);
+  memtools_allocation_extra* extra;
   char** comment;
   print_wrapped("%s:%zu bytes allocated at %p in file %s at line %d\n", 
-        allocation->alloc_type, allocation->n, allocation->memstart + allocation->n,
-        allocation->file, allocation->line);
+        site->alloc_type, memtools_memory_interface_allocation_size(memory_interface, allocation),
+        allocation->memstart, site->file, site->line);
 
-  if(allocation_has_been_violated(allocation)){
+  if(memtools_memory_interface_allocation_violated(memory_interface, allocation)){
     printf("\t %s!!MEMORY HAS BEEN VIOLATED!!%s\n", "\033[31m", "\033[0m");
   }
-  for(comment = allocation->comments; comment != allocation->comments + allocation->n_comments; ++comment){
+  extra = memtools_memory_interface_get_extra(memory_interface, allocation, false);
+  if(!extra){
+    return;
+  }
+  for(comment = extra->comments; comment != extra->comments + extra->n_comments; ++comment){
     printf("\t(%s)\n", *comment);
   }
 }
 
 /* print all allocations */
+/* caller holds the allocation lock */
+static void collect_stats(memtools_stats* stats){
+  memtools_overhead overhead;
+
+  stats->allocated_bytes = total_allocated_bytes;
+  stats->n_allocations = n_allocations;
+  stats->counted_bytes = __atomic_load_n(&counted_bytes, __ATOMIC_RELAXED);
+  stats->n_counted = __atomic_load_n(&n_counted_allocations, __ATOMIC_RELAXED);
+
+  memset(&overhead, 0, sizeof overhead);
+  memtools_memory_interface_overhead(memory_interface, &overhead);
+  stats->overhead_registry = overhead.registry;
+  stats->overhead_canaries = overhead.canaries + sizeof(untracked_header)*stats->n_counted;
+  stats->overhead_comments = overhead.comments;
+  stats->overhead_internal = overhead.internal + memtools_trace_overhead() +
+                             untracked_sets_overhead(passthrough_blocks) + untracked_sets_overhead(counted_blocks);
+}
+
 void memtools_print_allocated(){
+  memtools_stats stats;
+
   pthread_mutex_lock(&memory_allocations_lock);
-  print_wrapped("allocated %zu bytes in %d blocks\n", total_allocated_bytes, n_allocations);
+  collect_stats(&stats);
+  print_wrapped("allocated %zu bytes in %zu blocks\n", stats.allocated_bytes, stats.n_allocations);
+  if(stats.n_counted){
+    print_wrapped("counted %zu bytes in %zu blocks from MEMTOOLS_LEVEL 1 code\n", stats.counted_bytes, stats.n_counted);
+  }
   memtools_memory_interface_for_each(memory_interface, &print_allocation);
+
+  print_wrapped("overhead %zu bytes (registry %zu, canaries %zu, comments %zu, internal %zu)\n",
+                stats.overhead_registry + stats.overhead_canaries + stats.overhead_comments + stats.overhead_internal,
+                stats.overhead_registry, stats.overhead_canaries, stats.overhead_comments, stats.overhead_internal);
+  pthread_mutex_unlock(&memory_allocations_lock);
+}
+
+void memtools_get_stats(memtools_stats* stats){
+  pthread_mutex_lock(&memory_allocations_lock);
+  collect_stats(stats);
+  pthread_mutex_unlock(&memory_allocations_lock);
+}
+
+static int compare_file_and_line(const void* a, const void* b){
+  const memtools_site *x = a, *y = b;
+  int by_file = strcmp(x->file, y->file);
+  return by_file ? by_file : (x->line > y->line) - (x->line < y->line);
+}
+
+static int compare_bytes_copied(const void* a, const void* b){
+  const memtools_site *x = a, *y = b;
+  return (x->bytes_copied < y->bytes_copied) - (x->bytes_copied > y->bytes_copied);
+}
+
+/* print every realloc site, the ones that copied the most first. Sites are
+ * keyed on the __FILE__ pointer, which each translation unit has its own
+ * copy of, so the same file and line is merged here before printing. */
+void memtools_print_realloc_stats(){
+  memtools_site *sites, *site, *merged;
+  uint32_t id, n_sites = 0;
+
+  pthread_mutex_lock(&memory_allocations_lock);
+  sites = malloc((sizeof *sites)*(memtools_sites_count() + 1));
+  for(id = 0; id < memtools_sites_count(); ++id){
+    if(memtools_site_get(id)->n_reallocs){
+      sites[n_sites++] = *memtools_site_get(id);
+    }
+  }
   pthread_mutex_unlock(&memory_allocations_lock);
+
+  qsort(sites, n_sites, sizeof *sites, compare_file_and_line);
+  merged = sites;
+  for(site = sites + 1; site < sites + n_sites; ++site){
+    if(!compare_file_and_line(merged, site)){
+      merged->n_reallocs += site->n_reallocs;
+      merged->n_in_place += site->n_in_place;
+      merged->bytes_copied += site->bytes_copied;
+    } else {
+      *++merged = *site;
+    }
+  }
+  n_sites = n_sites ? merged - sites + 1 : 0;
+  qsort(sites, n_sites, sizeof *sites, compare_bytes_copied);
+
+  print_wrapped("%u realloc sites\n", n_sites);
+  for(site = sites; site != sites + n_sites; ++site){
+    print_wrapped("realloc in file %s at line %d: %zu reallocs, %zu in place, %zu bytes copied\n",
+                  site->file, site->line, site->n_reallocs, site->n_in_place, site->bytes_copied);
+  }
+  free(sites);
 }
 
 /* memtools version of free */
@@ -168,6 +594,15 @@ void memtools_free(void* ptr, unsigned line, char* file){
     return;    
   }
 
+  if(untracked_set_remove(passthrough_blocks, ptr)){
+    free(ptr);
+    return;
+  }
+  if(untracked_set_remove(counted_blocks, ptr)){
+    counted_free(ptr);
+    return;
+  }
+
   pthread_mutex_lock(&memory_allocations_lock);
   retval = memtools_memory_interface_destroy_allocation_by_pointer(&memory_interface, ptr);
   if(!retval.is_valid_ptr){
@@ -181,6 +616,7 @@ void memtools_free(void* ptr, unsigned line, char* file){
 
   n_allocations -= 1;
   total_allocated_bytes -= retval.n_bytes;
+  memtools_trace_record_op(MEMTOOLS_TRACE_FREE, 0, retval.trace_id);
   #if 0
   /* we can't use get_allocation_for pointer because we need 
    * the block index to erase the block from the array. */
@@ -220,19 +656,12 @@ void memtools_free(void* ptr, unsigned line, char* file){
   pthread_mutex_unlock(&memory_allocations_lock);
 }
 
-/* realloc with 64 bit header and footer */
-static inline void over_realloc(size_t n, memtools_allocation* curr){
-  unsigned long aligned_n = n + (n&7);
-  curr->memstart = realloc(curr->memstart - sizeof(uint64_t), aligned_n + sizeof(uint64_t)*2) + sizeof(uint64_t);
-  curr->n = n;
-
-  *(((uint64_t*)curr->memstart) - 1) = MAGIC_NUMBER;
-  *((uint64_t*)(curr->memstart + aligned_n)) = MAGIC_NUMBER;
-}
-
 /* memtools version of realloc */
 void* memtools_realloc(void* ptr, size_t n, unsigned int line, char* file){
+  uint8_t *memstart, *old_memstart;
   memtools_allocation* curr; 
+  memtools_site* site;
+  size_t copied, old_n;
 
   /* since you can use realloc as malloc if ptr is
    * NULL, we'll just use malloc for that. The only 
@@ -250,6 +679,14 @@ void* memtools_realloc(void* ptr, size_t n, unsigned int line, char* file){
     return NULL;
   }
 
+  /* blocks keep the level they were allocated at */
+  if(untracked_set_remove(passthrough_blocks, ptr)){
+    return passthrough_realloc(ptr, n);
+  }
+  if(untracked_set_remove(counted_blocks, ptr)){
+    return counted_realloc(ptr, n);
+  }
+
   pthread_mutex_lock(&memory_allocations_lock);
   curr = memtools_memory_interface_get_allocation_for_pointer(memory_interface, ptr);
   if(!curr){
@@ -257,13 +694,55 @@ void* memtools_realloc(void* ptr, size_t n, unsigned int line, char* file){
     exit(0);
   }
 
-  total_allocated_bytes = total_allocated_bytes - curr->n + n;
-  over_realloc(n, curr);
-  curr->line = line;
-  curr->file = file;
-  curr->alloc_type = ALLOC_TYPE_REALLOC;
+  /* like realloc, a failed resize leaves the old block as it was */
+  old_n = memtools_memory_interface_allocation_size(memory_interface, curr);
+  old_memstart = curr->memstart;
+  if(!memtools_memory_interface_resize_allocation(memory_interface, curr, n, &copied)){
+    pthread_mutex_unlock(&memory_allocations_lock);
+    return NULL;
+  }
+  total_allocated_bytes = total_allocated_bytes - old_n + n;
+
+  /* the block now belongs to this realloc's site, which keeps count of how
+   * often it had to move blocks */
+  curr->site = memtools_site_id(file, line, ALLOC_TYPE_REALLOC, memtools_site_get(curr->site)->canaried);
+  site = memtools_site_get(curr->site);
+  site->n_reallocs++;
+  site->n_in_place += curr->memstart == old_memstart;
+  site->bytes_copied += copied;
+  curr->trace_id = memtools_trace_record_op(MEMTOOLS_TRACE_REALLOC, n, curr->trace_id);
+  memstart = curr->memstart;
+  pthread_mutex_unlock(&memory_allocations_lock);
+  return memstart;
+}
+
+/* MEMTOOLS_LEVEL 2 version of realloc */
+void* memtools_registry_realloc(void* ptr, size_t n, unsigned int line, char* file){
+  if(!ptr){
+    return memtools_registry_malloc(n, line, file);
+  }
+  return memtools_realloc(ptr, n, line, file);
+}
+
+/* start logging every wrapper call to a binary trace at path */
+bool memtools_trace_start(char* path){
+  bool opened;
+
+  pthread_mutex_lock(&memory_allocations_lock);
+  opened = memtools_trace_open(path);
+  pthread_mutex_unlock(&memory_allocations_lock);
+
+  if(!opened){
+    print_wrapped("Could not open trace file %s\n", path);
+  }
+  return opened;
+}
+
+/* flush and close the current trace */
+void memtools_trace_stop(){
+  pthread_mutex_lock(&memory_allocations_lock);
+  memtools_trace_close();
   pthread_mutex_unlock(&memory_allocations_lock);
-  return curr->memstart;
 }
 
 /* append a tab to nonempty printf statements */
@@ -310,9 +789,14 @@ static void comment_copy(char **dest, char *src){
 
 void memtools_memory_comment_copy(void* dest_block, void* src_block){
   memtools_allocation *dest_allocation, *src_allocation;
+  memtools_allocation_extra *dest_extra, *src_extra;
   int n_original_comments;
   char **dest_comment, **src_comment;
 
+  if(is_untracked_block(src_block) || is_untracked_block(dest_block)){
+    return;
+  }
+
   //src_allocation = get_allocation_for_pointer(src_block);
   src_allocation = memtools_memory_interface_get_allocation_for_pointer(memory_interface, src_block);
   if(!src_allocation){
@@ -328,84 +812,74 @@ void memtools_memory_comment_copy(void* dest_block, void* src_block){
     exit(0);
   }
 
-  n_original_comments = dest_allocation->n_comments;
-  dest_allocation->n_comments += src_allocation->n_comments;
-  dest_allocation->comments = realloc(dest_allocation->comments, 
-                                      (sizeof *dest_allocation->comments)*dest_allocation->n_comments);
-  for(src_comment = src_allocation->comments, dest_comment = dest_allocation->comments + n_original_comments;
-      src_comment != src_allocation->comments + src_allocation->n_comments;
+  if(!memtools_memory_interface_get_extra(memory_interface, src_allocation, false)){
+    return;
+  }
+
+  /* creating the destination's extra record can move the source's */
+  dest_extra = memtools_memory_interface_get_extra(memory_interface, dest_allocation, true);
+  src_extra = memtools_memory_interface_get_extra(memory_interface, src_allocation, false);
+
+  n_original_comments = dest_extra->n_comments;
+  dest_extra->n_comments += src_extra->n_comments;
+  dest_extra->comments = realloc(dest_extra->comments, 
+                                 (sizeof *dest_extra->comments)*dest_extra->n_comments);
+  for(src_comment = src_extra->comments, dest_comment = dest_extra->comments + n_original_comments;
+      src_comment != src_extra->comments + src_extra->n_comments;
       ++src_comment, ++dest_comment){
     comment_copy(dest_comment, *src_comment);
   }
 }
 
-void* memtools_strdup(char* str, unsigned int line, char* file){
-  int slen;
-  pthread_mutex_lock(&memory_allocations_lock);
+static void* tracked_strndup(char* str, size_t n, unsigned int line, char* file, char* alloc_type,
+                             memtools_trace_op op, bool canaried){
+  size_t slen;
+  uint8_t* memstart;
 
   slen = strlen(str);
+  slen = slen > n ? n : slen;
 
-  /* add more memory for new malloc */
-  memtools_allocation* new = memtools_memory_interface_add_allocation(&memory_interface, (sizeof(char)*(slen+1)));
-  
-  strncpy((char*)new->memstart, str, (slen+1));
-
-  /* initialize current allocation */
-  new->line = line;
-  new->file = file;
-  new->alloc_type = ALLOC_TYPE_STRDUP;
-  new->comments = NULL;
-  new->n_comments = 0;
-  total_allocated_bytes += sizeof(char)*(slen + 1);
-  n_allocations += 1;
-  pthread_mutex_unlock(&memory_allocations_lock);
+  memstart = add_tracked_allocation(sizeof(char)*(slen+1), line, file, alloc_type, op, canaried);
+  if(memstart){
+    memcpy(memstart, str, slen);
+    memstart[slen] = '\0';
+  }
 
-  return new->memstart;
+  return memstart;
 }
 
-void* memtools_strndup(char* str, unsigned int n, unsigned int line, char* file){
-  int slen;
-  pthread_mutex_lock(&memory_allocations_lock);
+static void* tracked_calloc(size_t n, size_t m, unsigned int line, char* file, bool canaried){
+  uint8_t* memstart;
 
-  slen = strlen(str);
-  slen = slen > n ? n : slen;
-
-  /* add more memory for new malloc */
-  memtools_allocation* new = memtools_memory_interface_add_allocation(&memory_interface, (sizeof(char)*(slen+1)));
-  
-  strncpy((char*)new->memstart, str, (slen));
-
-  /* initialize current allocation */
-  new->line = line;
-  new->file = file;
-  new->alloc_type = ALLOC_TYPE_STRNDUP;
-  new->comments = NULL;
-  new->n_comments = 0;
-  total_allocated_bytes += sizeof(char)*(slen + 1);
-  n_allocations += 1;
-  pthread_mutex_unlock(&memory_allocations_lock);
+  if(m && n > SIZE_MAX/m){
+    return NULL;
+  }
+  memstart = add_tracked_allocation(n*m, line, file, ALLOC_TYPE_CALLOC, MEMTOOLS_TRACE_CALLOC, canaried);
+  return memstart ? memset(memstart, 0, n*m) : NULL;
+}
 
-  return new->memstart;
+void* memtools_strdup(char* str, unsigned int line, char* file){
+  return tracked_strndup(str, strlen(str), line, file, ALLOC_TYPE_STRDUP, MEMTOOLS_TRACE_STRDUP, true);
 }
 
-/* memtools version of malloc */
-void* memtools_calloc(unsigned int n, size_t m, unsigned int line, char* file){
-  pthread_mutex_lock(&memory_allocations_lock);
+void* memtools_strndup(char* str, size_t n, unsigned int line, char* file){
+  return tracked_strndup(str, n, line, file, ALLOC_TYPE_STRNDUP, MEMTOOLS_TRACE_STRNDUP, true);
+}
 
-  /* add more memory for new malloc */
-  memtools_allocation* new = memtools_memory_interface_add_allocation(&memory_interface, n*m);
-  memset(new->memstart, 0, n*m);
+/* memtools version of calloc */
+void* memtools_calloc(size_t n, size_t m, unsigned int line, char* file){
+  return tracked_calloc(n, m, line, file, true);
+}
 
-  /* initialize current allocation */
-  new->line = line;
-  new->file = file;
-  new->alloc_type = ALLOC_TYPE_CALLOC;
-  new->comments = NULL;
-  new->n_comments = 0;
-  total_allocated_bytes += n*m;
-  n_allocations += 1;
-  pthread_mutex_unlock(&memory_allocations_lock);
+/* MEMTOOLS_LEVEL 2 versions of strdup, strndup and calloc */
+void* memtools_registry_strdup(char* str, unsigned int line, char* file){
+  return tracked_strndup(str, strlen(str), line, file, ALLOC_TYPE_STRDUP, MEMTOOLS_TRACE_STRDUP, false);
+}
 
-  return new->memstart;
+void* memtools_registry_strndup(char* str, size_t n, unsigned int line, char* file){
+  return tracked_strndup(str, n, line, file, ALLOC_TYPE_STRNDUP, MEMTOOLS_TRACE_STRNDUP, false);
 }
 
+void* memtools_registry_calloc(size_t n, size_t m, unsigned int line, char* file){
+  return tracked_calloc(n, m, line, file, false);
+}
@@ -15,31 +15,81 @@
   #include "memtools_internal.h"
   #ifdef MEMTOOLS
 
-    #define malloc(n)     memtools_malloc (n, __LINE__, (char*)__FILE__)
-    #define free(p)       memtools_free   (p, __LINE__, (char*)__FILE__)
-    #define realloc(p, n) memtools_realloc(p, n, __LINE__, (char*)__FILE__)
-    #define strdup(s)     memtools_strdup (s, __LINE__, (char*)__FILE__)
-    #define strndup(s, n) memtools_strndup(s, n, __LINE__, (char*)__FILE__)
-    #define calloc(m, n)  memtools_calloc (m, n, __LINE__, (char*)__FILE__)
+    /* MEMTOOLS_LEVEL picks how much this file pays for tracking:
+     *   0 - plain libc blocks, each costs a hash set insert and remove so
+     *       other levels can free it. Memory from libc or other libraries
+     *       can be freed here too.
+     *   1 - only counted in memprint()'s totals
+     *   2 - tracked in the registry, no canaries
+     *   3 - tracked with canaries (default)
+     * memory can be freed or reallocated from a file at any other level. */
+    #ifndef MEMTOOLS_LEVEL
+      #define MEMTOOLS_LEVEL 3
+    #endif
+
+    #if MEMTOOLS_LEVEL == 0
+      #define malloc(n)     memtools_passthrough_malloc (n)
+      #define free(p)       memtools_passthrough_free   (p, __LINE__, (char*)__FILE__)
+      #define realloc(p, n) memtools_passthrough_realloc(p, n, __LINE__, (char*)__FILE__)
+      #define strdup(s)     memtools_passthrough_strdup (s)
+      #define strndup(s, n) memtools_passthrough_strndup(s, n)
+      #define calloc(m, n)  memtools_passthrough_calloc (m, n)
+    #elif MEMTOOLS_LEVEL == 1
+      #define malloc(n)     memtools_counted_malloc (n)
+      #define free(p)       memtools_free           (p, __LINE__, (char*)__FILE__)
+      #define realloc(p, n) memtools_counted_realloc(p, n, __LINE__, (char*)__FILE__)
+      #define strdup(s)     memtools_counted_strdup (s)
+      #define strndup(s, n) memtools_counted_strndup(s, n)
+      #define calloc(m, n)  memtools_counted_calloc (m, n)
+    #elif MEMTOOLS_LEVEL == 2
+      #define malloc(n)     memtools_registry_malloc (n, __LINE__, (char*)__FILE__)
+      #define free(p)       memtools_free            (p, __LINE__, (char*)__FILE__)
+      #define realloc(p, n) memtools_registry_realloc(p, n, __LINE__, (char*)__FILE__)
+      #define strdup(s)     memtools_registry_strdup (s, __LINE__, (char*)__FILE__)
+      #define strndup(s, n) memtools_registry_strndup(s, n, __LINE__, (char*)__FILE__)
+      #define calloc(m, n)  memtools_registry_calloc (m, n, __LINE__, (char*)__FILE__)
+    #else
+      #define malloc(n)     memtools_malloc (n, __LINE__, (char*)__FILE__)
+      #define free(p)       memtools_free   (p, __LINE__, (char*)__FILE__)
+      #define realloc(p, n) memtools_realloc(p, n, __LINE__, (char*)__FILE__)
+      #define strdup(s)     memtools_strdup (s, __LINE__, (char*)__FILE__)
+      #define strndup(s, n) memtools_strndup(s, n, __LINE__, (char*)__FILE__)
+      #define calloc(m, n)  memtools_calloc (m, n, __LINE__, (char*)__FILE__)
+    #endif
 
     #define memprint()           memtools_print_allocated()
-    #define memcomment(p, ...)   memtools_memory_comment(p, __VA_ARGS__)
-    #define memcomment_copy(dest, src) memtools_memory_comment_copy(dest, src)
-    #define memtest(p, ...)  if(!memtools_is_valid_pointer(p)){\
-                               printf("memtools: memory tested at %p in file %s at line %d was invalid.\n", \
-                                      p, __FILE__, __LINE__);\
-                               memtools_wrapped_printf(__VA_ARGS__);\
-                             } 
-
-    #define memviolated(p, ...)  if(memtools_has_memory_been_violated(p)){\
-                                   printf("memtools: memory tested at %p in file %s at line %d has been violated.\n", \
-                                          p, __FILE__, __LINE__);\
-                                   memtools_wrapped_printf(__VA_ARGS__);\
-                                 } 
+    #define memreallocs()        memtools_print_realloc_stats()
+    #define memtrace_start(path) memtools_trace_start(path)
+    #define memtrace_stop()      memtools_trace_stop()
+
+    /* blocks below level 2 have no registry entry to comment on or test */
+    #if MEMTOOLS_LEVEL >= 2
+      #define memcomment(p, ...)   memtools_memory_comment(p, __VA_ARGS__)
+      #define memcomment_copy(dest, src) memtools_memory_comment_copy(dest, src)
+      #define memtest(p, ...)  if(!memtools_is_valid_pointer(p)){\
+                                 printf("memtools: memory tested at %p in file %s at line %d was invalid.\n", \
+                                        p, __FILE__, __LINE__);\
+                                 memtools_wrapped_printf(__VA_ARGS__);\
+                               } 
+
+      #define memviolated(p, ...)  if(memtools_has_memory_been_violated(p)){\
+                                     printf("memtools: memory tested at %p in file %s at line %d has been violated.\n", \
+                                            p, __FILE__, __LINE__);\
+                                     memtools_wrapped_printf(__VA_ARGS__);\
+                                   } 
+    #else
+      #define memcomment(p, ...)
+      #define memcomment_copy(dest, src)
+      #define memtest(p, ...)
+      #define memviolated(p, ...)
+    #endif
   #else
     #define memprint()
+    #define memreallocs()
     #define memcomment(p, ...)
     #define memcomment_copy(dest, src)
+    #define memtrace_start(path)
+    #define memtrace_stop()
     #define memtest(p, format, ...)
     #define memviolated(p, format, ...) 
   #endif
@@ -20,11 +20,44 @@ void* memtools_strdup(char* str, unsigned int line, char* file); /* Version of s
 void* memtools_strndup(char* str, size_t n, unsigned int line, char* file); /* Version of strndup which keeps track of line and file where memroy was allocated*/
 void* memtools_calloc(size_t n, size_t m, unsigned int line, char* file); /* Version of calloc which keeps track of line and file where memory was allocated*/
 
+/* MEMTOOLS_LEVEL 2: tracked in the registry but without canaries */
+void* memtools_registry_malloc (size_t n, unsigned int line, char* file);
+void* memtools_registry_realloc(void* ptr, size_t n, unsigned int line, char* file);
+void* memtools_registry_strdup (char* str, unsigned int line, char* file);
+void* memtools_registry_strndup(char* str, size_t n, unsigned int line, char* file);
+void* memtools_registry_calloc (size_t n, size_t m, unsigned int line, char* file);
+
+/* MEMTOOLS_LEVEL 1: only counted in the totals */
+void* memtools_counted_malloc (size_t n);
+void* memtools_counted_realloc(void* ptr, size_t n, unsigned int line, char* file);
+void* memtools_counted_strdup (char* str);
+void* memtools_counted_strndup(char* str, size_t n);
+void* memtools_counted_calloc (size_t n, size_t m);
+
+/* MEMTOOLS_LEVEL 0: plain libc, remembered so blocks can be freed from any level */
+void* memtools_passthrough_malloc (size_t n);
+void* memtools_passthrough_realloc(void* ptr, size_t n, unsigned int line, char* file);
+void* memtools_passthrough_strdup (char* str);
+void* memtools_passthrough_strndup(char* str, size_t n);
+void* memtools_passthrough_calloc (size_t n, size_t m);
+void  memtools_passthrough_free   (void* ptr, unsigned int line, char* file);
+
+/* the totals memtools_print_allocated reports */
+typedef struct{
+  size_t allocated_bytes, n_allocations; /* tracked, MEMTOOLS_LEVEL 2 and 3 */
+  size_t counted_bytes, n_counted;       /* MEMTOOLS_LEVEL 1 */
+  size_t overhead_registry, overhead_canaries, overhead_comments, overhead_internal;
+}memtools_stats;
+
 void memtools_print_allocated(); /* print all currently allocated memory */
+void memtools_get_stats(memtools_stats* stats); /* fill in the current totals */
+void memtools_print_realloc_stats(); /* print how much each realloc site copied */
 bool memtools_has_memory_been_violated(void* ptr); /* check if any over allocated segments are corrupted */
 bool memtools_memory_comment(void* ptr, char* fmt, ...); /* add comment to memory */
 bool memtools_is_valid_pointer(void* ptr); /* check if pointer is valid */
 void memtools_memory_comment_copy(void* dest_block, void* src_block);
+bool memtools_trace_start(char* path); /* record every wrapper call to a binary trace file */
+void memtools_trace_stop(); /* flush and close the trace file */
 
 int memtools_wrapped_printf(char* fmt, ...);
 
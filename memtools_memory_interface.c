@@ -4,49 +4,217 @@
 /* jordan bonecutter * * * * * * * * * * * * * * * * * * * * * * * * */
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#define _GNU_SOURCE
+
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include "memtools_sites.h"
+
+/* blocks are resized in place while they fit in what the allocator really
+ * gave us, and large blocks are mapped directly so they can grow with mremap */
+#if defined(__APPLE__)
+  #include <malloc/malloc.h>
+  #define usable_size(p) malloc_size(p)
+#elif defined(__GLIBC__)
+  #include <malloc.h>
+  #define usable_size(p) malloc_usable_size(p)
+#endif
+
+#ifdef __linux__
+  #include <sys/mman.h>
+  #include <unistd.h>
+  #define MEMTOOLS_USE_MREMAP
+#endif
 
 #define MAGIC_NUMBER 0xEC5EE674CA4A4A96
+#define MEMTOOLS_SIZE_OVERFLOW UINT32_MAX
+#define MEMTOOLS_MREMAP_THRESHOLD (128*1024)
+#define MEMTOOLS_MAX_BLOCK (SIZE_MAX - 4*sizeof(uint64_t)) /* leaves room for the header and footer */
 
 typedef struct{
-  unsigned int line;
   uint8_t* memstart;
-  size_t n;
-  char **comments, *file, *alloc_type;
-  unsigned int n_comments;
+  uint32_t n, site, trace_id;
+  uint32_t extra; /* index + 1 of the extra record, 0 if there is none */
 }memtools_allocation;
 
+typedef struct{
+  size_t n;      /* size, or while the record is unused the index + 1 of the next unused one */
+  size_t mapped; /* length of the mapping for blocks memtools mmaps itself, 0 otherwise */
+  char **comments;
+  unsigned int n_comments;
+  bool in_use;
+}memtools_allocation_extra;
+
 typedef struct{
   unsigned n_allocations;
   memtools_allocation* allocations;
+  unsigned n_extras;
+  memtools_allocation_extra* extras;
+  unsigned free_extra; /* index + 1 of the first unused extra record, 0 if there is none */
 }memtools_memory_interface;
 
 typedef struct{
   bool is_valid_ptr, shifted_ptr;
   size_t n_bytes;
   void* memstart;
+  uint32_t trace_id;
 }memtools_free_info;
 
+typedef struct{
+  size_t registry, canaries, comments, internal;
+}memtools_overhead;
+
 memtools_memory_interface* memtools_memory_interface_create(){
   return (memtools_memory_interface*)NULL;
 }
 
-/* malloc w/ 64 bit header and footer */
-static inline void over_malloc(size_t n, memtools_allocation* curr){
-  /* ensure footer is 64-bit aligned */
-  unsigned long aligned_n = n + (n&7);
-  curr->memstart = malloc(aligned_n + sizeof(uint64_t)*2) + sizeof(uint64_t);
-  curr->n = n;
+memtools_allocation_extra*
+memtools_memory_interface_get_extra(memtools_memory_interface* interface, memtools_allocation* allocation, bool create){
+  memtools_allocation_extra* extra;
+  unsigned i, old_n_extras;
+
+  if(allocation->extra){
+    return interface->extras + allocation->extra - 1;
+  }
+  if(!create){
+    return NULL;
+  }
+
+  /* unused records are chained through n, double the array when they run out */
+  if(!interface->free_extra){
+    old_n_extras = interface->n_extras;
+    interface->n_extras = old_n_extras ? old_n_extras*2 : 4;
+    interface->extras = realloc(interface->extras, (sizeof *interface->extras)*interface->n_extras);
+    for(i = interface->n_extras; i > old_n_extras; --i){
+      interface->extras[i - 1].in_use = false;
+      interface->extras[i - 1].n = interface->free_extra;
+      interface->free_extra = i;
+    }
+  }
+  extra = interface->extras + interface->free_extra - 1;
+  interface->free_extra = extra->n;
+
+  memset(extra, 0, sizeof *extra);
+  extra->in_use = true;
+  allocation->extra = extra - interface->extras + 1;
+  return extra;
+}
+
+size_t memtools_memory_interface_allocation_size(memtools_memory_interface* interface, memtools_allocation* allocation){
+  if(allocation->n != MEMTOOLS_SIZE_OVERFLOW){
+    return allocation->n;
+  }
+  return interface->extras[allocation->extra - 1].n;
+}
+
+static void set_allocation_size(memtools_memory_interface* interface, memtools_allocation* allocation, size_t n){
+  if(n < MEMTOOLS_SIZE_OVERFLOW){
+    allocation->n = n;
+  } else {
+    allocation->n = MEMTOOLS_SIZE_OVERFLOW;
+    memtools_memory_interface_get_extra(interface, allocation, true)->n = n;
+  }
+}
+
+/* footer canaries start at the next 64 bit boundary after the block */
+static inline size_t footer_offset(size_t n){
+  return (n + 7) & ~(size_t)7;
+}
+
+/* header magic number, plus the padding and footer of canaried blocks */
+static inline size_t canary_bytes(size_t n, bool canaried){
+  return sizeof(uint64_t) + (canaried ? footer_offset(n) - n + sizeof(uint64_t) : 0);
+}
+
+/* write the header and, if the site asked for canaries, the footer */
+static inline void write_canaries(size_t n, bool canaried, uint8_t* memstart){
+  *(((uint64_t*)memstart) - 1) = MAGIC_NUMBER;
+  if(canaried){
+    *((uint64_t*)(memstart + footer_offset(n))) = MAGIC_NUMBER;
+  }
+}
+
+#ifdef MEMTOOLS_USE_MREMAP
+static size_t page_round(size_t n){
+  size_t page = sysconf(_SC_PAGESIZE);
+  return (n + page - 1) & ~(page - 1);
+}
+
+/* mmap a block big enough for total bytes, setting *mapped to its length */
+static uint8_t* map_block(size_t total, size_t* mapped){
+  uint8_t* base;
+
+  *mapped = page_round(total);
+  base = mmap(NULL, *mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return base == MAP_FAILED ? NULL : base;
+}
+#endif
+
+/* allocate the underlying block, including header and canaries, NULL if
+ * there was no memory for it */
+static uint8_t* allocate_block(memtools_memory_interface* interface, memtools_allocation* curr, size_t total){
+#ifdef MEMTOOLS_USE_MREMAP
+  size_t mapped;
+  uint8_t* base;
+
+  if(total >= MEMTOOLS_MREMAP_THRESHOLD){
+    base = map_block(total, &mapped);
+    if(base){
+      memtools_memory_interface_get_extra(interface, curr, true)->mapped = mapped;
+    }
+    return base;
+  }
+#endif
+  return malloc(total);
+}
+
+static void release_block(memtools_allocation_extra* extra, uint8_t* base){
+#ifdef MEMTOOLS_USE_MREMAP
+  if(extra && extra->mapped){
+    munmap(base, extra->mapped);
+    return;
+  }
+#endif
+  free(base);
+}
+
+/* bytes available in the underlying block, from the header on */
+static size_t block_capacity(memtools_memory_interface* interface, memtools_allocation* curr, size_t total){
+  memtools_allocation_extra* extra = memtools_memory_interface_get_extra(interface, curr, false);
+
+  if(extra && extra->mapped){
+    return extra->mapped;
+  }
+#ifdef usable_size
+  return usable_size(curr->memstart - sizeof(uint64_t));
+#else
+  return total;
+#endif
+}
+
+/* malloc w/ 64 bit header and footer, blocks without canaries keep the
+ * header so both kinds of tracked block share one layout */
+static inline bool over_malloc(memtools_memory_interface* interface, size_t n, memtools_allocation* curr){
+  bool canaried = memtools_site_get(curr->site)->canaried;
+  uint8_t* base;
 
-  /* write magic number to header and footer */
-  *(((uint64_t*)curr->memstart) - 1) = MAGIC_NUMBER;
-  *((uint64_t*)(curr->memstart + aligned_n)) = MAGIC_NUMBER;
+  if(n > MEMTOOLS_MAX_BLOCK){
+    return false;
+  }
+  base = allocate_block(interface, curr, n + canary_bytes(n, canaried));
+  if(!base){
+    return false;
+  }
+  curr->memstart = base + sizeof(uint64_t);
+  set_allocation_size(interface, curr, n);
+  write_canaries(n, canaried, curr->memstart);
+  return true;
 }
 
-memtools_allocation* memtools_memory_interface_add_allocation(memtools_memory_interface** interface, size_t n){
+memtools_allocation* memtools_memory_interface_add_allocation(memtools_memory_interface** interface, size_t n, uint32_t site){
   memtools_memory_interface *interface_cache;
   memtools_allocation *ret;
   if(!*interface){
@@ -54,6 +222,9 @@ memtools_allocation* memtools_memory_interface_add_allocation(memtools_memory_in
     interface_cache = *interface;
     interface_cache->n_allocations = 1;
     interface_cache->allocations = malloc(sizeof *interface_cache->allocations);
+    interface_cache->n_extras = 0;
+    interface_cache->extras = NULL;
+    interface_cache->free_extra = 0;
   } else {
     interface_cache = *interface;
     interface_cache->allocations = realloc(interface_cache->allocations,
@@ -61,12 +232,101 @@ memtools_allocation* memtools_memory_interface_add_allocation(memtools_memory_in
     ++interface_cache->n_allocations;
   }
   ret = interface_cache->allocations + (interface_cache->n_allocations - 1);
-  over_malloc(n, ret);
-  return ret;
+  ret->site = site;
+  ret->trace_id = 0;
+  ret->extra = 0;
+  if(over_malloc(interface_cache, n, ret)){
+    return ret;
+  }
+
+  /* no memory for the block, drop the entry we just made for it */
+  if(--interface_cache->n_allocations == 0){
+    free(interface_cache->allocations);
+    free(interface_cache->extras);
+    free(*interface);
+    *interface = NULL;
+  }
+  return NULL;
 }
 
-static bool pointer_contained_in_allocation(memtools_allocation* allocation, void* ptr){
-  return ((uint8_t*)ptr >= allocation->memstart) && ((uint8_t*)ptr <= allocation->memstart + allocation->n - 1);
+/* realloc w/ 64 bit header and footer. Blocks that still fit in their
+ * capacity (and don't leave more than half of it unused) stay where they
+ * are and only the footer moves, large blocks are moved with mremap.
+ * Sets *copied to the number of bytes copied to move the block. Returns
+ * false if there was no memory, the block and its size are unchanged then. */
+bool memtools_memory_interface_resize_allocation(memtools_memory_interface* interface, memtools_allocation* curr, size_t n, size_t* copied){
+  bool canaried = memtools_site_get(curr->site)->canaried;
+  size_t old_n = memtools_memory_interface_allocation_size(interface, curr);
+  size_t old_total = old_n + canary_bytes(old_n, canaried);
+  size_t total = n + canary_bytes(n, canaried);
+  size_t capacity = block_capacity(interface, curr, old_total);
+  uint8_t *base = curr->memstart - sizeof(uint64_t), *new_base;
+#ifdef MEMTOOLS_USE_MREMAP
+  memtools_allocation_extra* extra = memtools_memory_interface_get_extra(interface, curr, false);
+  size_t mapped;
+#endif
+
+  *copied = 0;
+  if(n > MEMTOOLS_MAX_BLOCK){
+    return false;
+  }
+  if(total <= capacity && total*2 > capacity){
+    set_allocation_size(interface, curr, n);
+    if(canaried){
+      *((uint64_t*)(curr->memstart + footer_offset(n))) = MAGIC_NUMBER;
+    }
+    return true;
+  }
+
+#ifdef MEMTOOLS_USE_MREMAP
+  if(extra && extra->mapped){
+    mapped = page_round(total);
+    new_base = mremap(base, extra->mapped, mapped, MREMAP_MAYMOVE);
+    if(new_base == MAP_FAILED){
+      return false;
+    }
+    extra->mapped = mapped;
+  } else if(total >= MEMTOOLS_MREMAP_THRESHOLD){
+    new_base = map_block(total, &mapped);
+    if(!new_base){
+      return false;
+    }
+    *copied = old_n < n ? old_n : n;
+    memcpy(new_base + sizeof(uint64_t), curr->memstart, *copied);
+    free(base);
+    memtools_memory_interface_get_extra(interface, curr, true)->mapped = mapped;
+  } else
+#endif
+  {
+    new_base = realloc(base, total);
+    if(!new_base){
+      return false;
+    }
+    if(new_base != base){
+      *copied = old_n < n ? old_n : n;
+    }
+  }
+
+  curr->memstart = new_base + sizeof(uint64_t);
+  set_allocation_size(interface, curr, n);
+  write_canaries(n, canaried, curr->memstart);
+  return true;
+}
+
+/* check if allocation has been violated by looking at header and footer */
+bool memtools_memory_interface_allocation_violated(memtools_memory_interface* interface, memtools_allocation* allocation){
+  size_t n = memtools_memory_interface_allocation_size(interface, allocation);
+
+  if(!memtools_site_get(allocation->site)->canaried){
+    return false;
+  }
+  return *((uint64_t*)(allocation->memstart + footer_offset(n))) != MAGIC_NUMBER ||
+         *(((uint64_t*)allocation->memstart)-1) != MAGIC_NUMBER;
+}
+
+static bool pointer_contained_in_allocation(memtools_memory_interface* interface, memtools_allocation* allocation, void* ptr){
+  return ((uint8_t*)ptr >= allocation->memstart) &&
+         ((uint8_t*)ptr <= allocation->memstart + memtools_memory_interface_allocation_size(interface, allocation) - 1);
 }
 
 memtools_allocation* memtools_memory_interface_get_allocation_for_pointer(memtools_memory_interface* interface, void* p){
@@ -76,7 +336,7 @@ memtools_allocation* memtools_memory_interface_get_allocation_for_pointer(memtoo
 
   memtools_allocation* iterator;
   for(iterator = interface->allocations; iterator != interface->allocations + interface->n_allocations; ++iterator){
-    if(pointer_contained_in_allocation(iterator, p)){
+    if(pointer_contained_in_allocation(interface, iterator, p)){
       return iterator;
     }
   }
@@ -89,6 +349,7 @@ memtools_memory_interface_destroy_allocation_by_pointer(memtools_memory_interfac
   int i;
   memtools_memory_interface *interface_cache = *interface;
   memtools_allocation *iterator;
+  memtools_allocation_extra *extra;
   memtools_free_info ret;
   char** comment;
 
@@ -96,14 +357,15 @@ memtools_memory_interface_destroy_allocation_by_pointer(memtools_memory_interfac
   ret.shifted_ptr = false;
   ret.n_bytes = 0;
   ret.memstart = 0;
-  if(!interface){
+  ret.trace_id = 0;
+  if(!interface_cache){
     return ret;
   }
   for(i = 0, iterator = interface_cache->allocations;
       iterator != interface_cache->allocations + interface_cache->n_allocations;
       ++iterator, ++i)
   {
-    if(pointer_contained_in_allocation(iterator, ptr)){
+    if(pointer_contained_in_allocation(interface_cache, iterator, ptr)){
       ret.is_valid_ptr = true;
       break;
     }
@@ -117,14 +379,19 @@ memtools_memory_interface_destroy_allocation_by_pointer(memtools_memory_interfac
     ret.shifted_ptr = true;
   }
   ret.memstart = iterator->memstart;
-  ret.n_bytes = iterator->n;
-  free(iterator->memstart - sizeof(uint64_t));
+  ret.n_bytes = memtools_memory_interface_allocation_size(interface_cache, iterator);
+  ret.trace_id = iterator->trace_id;
 
-  for(comment = iterator->comments; comment != iterator->comments + iterator->n_comments; ++comment){
-    free(*comment);
-  }
-  if(iterator->comments){
-    free(iterator->comments);
+  extra = memtools_memory_interface_get_extra(interface_cache, iterator, false);
+  release_block(extra, iterator->memstart - sizeof(uint64_t));
+  if(extra){
+    for(comment = extra->comments; comment != extra->comments + extra->n_comments; ++comment){
+      free(*comment);
+    }
+    free(extra->comments);
+    extra->in_use = false;
+    extra->n = interface_cache->free_extra;
+    interface_cache->free_extra = iterator->extra;
   }
 
   /* erase free'd block by shifting down all the next allocations */
@@ -133,11 +400,13 @@ memtools_memory_interface_destroy_allocation_by_pointer(memtools_memory_interfac
   }
   --interface_cache->n_allocations;
   if(interface_cache->n_allocations == 0){
+    free(interface_cache->allocations);
+    free(interface_cache->extras);
     free(*interface);
     *interface = NULL;
   } else {
     interface_cache->allocations = realloc(interface_cache->allocations,
-                        (sizeof **interface) + (sizeof *(*interface)->allocations)*(*interface)->n_allocations);
+                        (sizeof *interface_cache->allocations)*interface_cache->n_allocations);
   }
 
   return ret;
@@ -155,3 +424,34 @@ void memtools_memory_interface_for_each(memtools_memory_interface *interface, vo
   }
 }
 
+/* add up what the registry, canaries and comments cost */
+void memtools_memory_interface_overhead(memtools_memory_interface *interface, memtools_overhead* overhead){
+  memtools_allocation *iterator;
+  memtools_allocation_extra *extra;
+  char** comment;
+
+  overhead->registry += memtools_sites_overhead();
+  if(!interface){
+    return;
+  }
+
+  overhead->registry += (sizeof *interface) +
+                        (sizeof *interface->allocations)*interface->n_allocations +
+                        (sizeof *interface->extras)*interface->n_extras;
+
+  for(iterator = interface->allocations; iterator != interface->allocations + interface->n_allocations; ++iterator){
+    overhead->canaries += canary_bytes(memtools_memory_interface_allocation_size(interface, iterator),
+                                       memtools_site_get(iterator->site)->canaried);
+  }
+
+  for(extra = interface->extras; extra != interface->extras + interface->n_extras; ++extra){
+    if(!extra->in_use){
+      continue;
+    }
+    overhead->comments += (sizeof *extra->comments)*extra->n_comments;
+    for(comment = extra->comments; comment != extra->comments + extra->n_comments; ++comment){
+      overhead->comments += strlen(*comment) + 1;
+    }
+  }
+}
+
@@ -7,27 +7,48 @@
 #ifndef memtools_memory_interface_INCLUDE_GUARD
 #define memtools_memory_interface_INCLUDE_GUARD
 
+/* sizes that don't fit in 32 bits are kept in the extra record */
+#define MEMTOOLS_SIZE_OVERFLOW UINT32_MAX
+
 typedef struct{
-  unsigned int line;
   uint8_t* memstart;
-  size_t n;
-  char **comments, *file, *alloc_type;
-  unsigned int n_comments;
+  uint32_t n, site, trace_id;
+  uint32_t extra; /* index + 1 of the extra record, 0 if there is none */
 }memtools_allocation;
 
+/* rarely needed data, kept out of line so most blocks don't pay for it */
+typedef struct{
+  size_t n;      /* size, or while the record is unused the index + 1 of the next unused one */
+  size_t mapped; /* length of the mapping for blocks memtools mmaps itself, 0 otherwise */
+  char **comments;
+  unsigned int n_comments;
+  bool in_use;
+}memtools_allocation_extra;
+
 typedef struct{
   bool is_valid_ptr, shifted_ptr;
   size_t n_bytes;
   void* memstart;
+  uint32_t trace_id;
 }memtools_free_info;
 
+/* bytes memtools spends on itself, none of which is in the allocated totals */
+typedef struct{
+  size_t registry, canaries, comments, internal;
+}memtools_overhead;
+
 typedef void* memtools_memory_interface;
 
 memtools_memory_interface* memtools_memory_interface_create();
-memtools_allocation* memtools_memory_interface_add_allocation(memtools_memory_interface**, size_t n);
+memtools_allocation* memtools_memory_interface_add_allocation(memtools_memory_interface**, size_t n, uint32_t site);
 memtools_allocation* memtools_memory_interface_get_allocation_for_pointer(memtools_memory_interface*, void*);
 memtools_free_info memtools_memory_interface_destroy_allocation_by_pointer(memtools_memory_interface**, void*);
 void memtools_memory_interface_for_each(memtools_memory_interface*, void (*for_each)(memtools_allocation*));
+bool memtools_memory_interface_resize_allocation(memtools_memory_interface*, memtools_allocation*, size_t n, size_t* copied);
+size_t memtools_memory_interface_allocation_size(memtools_memory_interface*, memtools_allocation*);
+bool memtools_memory_interface_allocation_violated(memtools_memory_interface*, memtools_allocation*);
+memtools_allocation_extra* memtools_memory_interface_get_extra(memtools_memory_interface*, memtools_allocation*, bool create);
+void memtools_memory_interface_overhead(memtools_memory_interface*, memtools_overhead*);
 
 #endif
 
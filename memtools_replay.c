@@ -0,0 +1,359 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* memtools_replay.c * * * * * * * * * * * * * * * * * * * * * * * * */
+/* 19 october 2026 * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* jordan bonecutter * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/*
+ * Replays a trace recorded with memtrace_start() as fast as possible and
+ * reports throughput, per-operation latency percentiles and peak RSS.
+ *
+ * Every recorded thread's calls are replayed in their recorded order by the
+ * same replay thread, and a call that consumes a block made on another thread
+ * waits until that block exists, so each run performs exactly the same
+ * sequence of allocator calls.
+ * */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "memtools_internal.h"
+#include "memtools_trace.h"
+
+typedef struct{
+  const char* name;
+  void* (*malloc) (size_t n);
+  void* (*calloc) (size_t n, size_t m);
+  void* (*realloc)(void* ptr, size_t n);
+  char* (*strndup)(const char* str, size_t n);
+  void  (*free)   (void* ptr);
+}replay_backend;
+
+typedef struct{
+  unsigned int n_records;
+  uint32_t* records;   /* indices into the global record array, in recorded order */
+  uint64_t start_ns, end_ns;
+  pthread_t thread;
+}replay_thread;
+
+static void* replay_memtools_malloc(size_t n){
+  return memtools_malloc(n, __LINE__, (char*)__FILE__);
+}
+
+static void* replay_memtools_calloc(size_t n, size_t m){
+  return memtools_calloc(n, m, __LINE__, (char*)__FILE__);
+}
+
+static void* replay_memtools_realloc(void* ptr, size_t n){
+  return memtools_realloc(ptr, n, __LINE__, (char*)__FILE__);
+}
+
+static char* replay_memtools_strndup(const char* str, size_t n){
+  return memtools_strndup((char*)str, n, __LINE__, (char*)__FILE__);
+}
+
+static void replay_memtools_free(void* ptr){
+  memtools_free(ptr, __LINE__, (char*)__FILE__);
+}
+
+/* allocators linked in through LD_PRELOAD are measured with the libc backend */
+static const replay_backend backends[] = {
+  {"libc",     malloc,                 calloc,                 realloc,                 strndup,
+               free},
+  {"memtools", replay_memtools_malloc, replay_memtools_calloc, replay_memtools_realloc, replay_memtools_strndup,
+               replay_memtools_free},
+};
+
+static const char* op_names[MEMTOOLS_TRACE_N_OPS] = {
+  NULL, "malloc", "calloc", "realloc", "free", "strdup", "strndup"
+};
+
+/* replay state shared by all threads */
+static const replay_backend* backend;
+static memtools_trace_record* records;
+static unsigned int n_records;
+static uint64_t* latencies;  /* latency of each record, in nanoseconds */
+static void** blocks;        /* live block for each trace id */
+static int* block_ready;     /* set once blocks[id] has been produced */
+static char* dup_source;      /* string long enough for every strdup and strndup in the trace */
+static bool touch_memory = false;
+static unsigned int n_waiting_threads; /* threads not yet ready to start */
+
+static uint64_t now_ns(){
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec*1000000000ull + now.tv_nsec;
+}
+
+static long peak_rss_kib(){
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static void wait_for_block(uint32_t id){
+  while(!__atomic_load_n(block_ready + id, __ATOMIC_ACQUIRE)){
+    sched_yield();
+  }
+}
+
+/* hold every thread until all of them are running, pthread barriers aren't
+ * available everywhere (macOS) so this spins like wait_for_block */
+static void wait_for_all_threads(){
+  __atomic_sub_fetch(&n_waiting_threads, 1, __ATOMIC_ACQ_REL);
+  while(__atomic_load_n(&n_waiting_threads, __ATOMIC_ACQUIRE)){
+    sched_yield();
+  }
+}
+
+static void publish_block(uint32_t id, void* block){
+  blocks[id] = block;
+  __atomic_store_n(block_ready + id, 1, __ATOMIC_RELEASE);
+}
+
+/* replay one call, whatever block it consumes must already be published */
+static void replay_record(memtools_trace_record* record){
+  void* block;
+
+  switch(record->op){
+    case MEMTOOLS_TRACE_FREE:
+      backend->free(blocks[record->old_id]);
+      blocks[record->old_id] = NULL;
+      return;
+    case MEMTOOLS_TRACE_REALLOC:
+      block = backend->realloc(record->old_id ? blocks[record->old_id] : NULL, record->size);
+      if(record->old_id){
+        blocks[record->old_id] = NULL;
+      }
+      break;
+    case MEMTOOLS_TRACE_CALLOC:
+      block = backend->calloc(1, record->size);
+      break;
+    case MEMTOOLS_TRACE_STRDUP:
+    case MEMTOOLS_TRACE_STRNDUP:
+      /* the recorded size includes the terminator */
+      block = backend->strndup(dup_source, record->size ? record->size - 1 : 0);
+      break;
+    default:
+      block = backend->malloc(record->size);
+      break;
+  }
+
+  if(touch_memory && block){
+    memset(block, 0, record->size);
+  }
+  publish_block(record->new_id, block);
+}
+
+static void* replay_thread_main(void* arg){
+  replay_thread* self = arg;
+  memtools_trace_record* record;
+  uint32_t *index;
+  uint64_t start;
+
+  wait_for_all_threads();
+  self->start_ns = now_ns();
+  for(index = self->records; index != self->records + self->n_records; ++index){
+    record = records + *index;
+
+    /* waiting for another thread's block isn't the allocator's latency */
+    if(record->old_id){
+      wait_for_block(record->old_id);
+    }
+    start = now_ns();
+    replay_record(record);
+    latencies[*index] = now_ns() - start;
+  }
+  self->end_ns = now_ns();
+
+  return NULL;
+}
+
+static bool load_trace(const char* path, uint32_t* max_id, unsigned int* n_threads){
+  memtools_trace_record* record;
+  uint64_t dup_size = 1;
+
+  records = memtools_trace_load(path, &n_records);
+  if(!records){
+    fprintf(stderr, "memtools-replay: could not read a memtools trace from %s\n", path);
+    return false;
+  }
+
+  *max_id = 0;
+  *n_threads = 0;
+  for(record = records; record != records + n_records; ++record){
+    *max_id = record->new_id > *max_id ? record->new_id : *max_id;
+    *n_threads = record->thread + 1u > *n_threads ? record->thread + 1u : *n_threads;
+    if(record->op == MEMTOOLS_TRACE_STRDUP || record->op == MEMTOOLS_TRACE_STRNDUP){
+      dup_size = record->size > dup_size ? record->size : dup_size;
+    }
+  }
+
+  dup_source = malloc(dup_size);
+  memset(dup_source, 'x', dup_size - 1);
+  dup_source[dup_size - 1] = '\0';
+
+  return true;
+}
+
+static int compare_latency(const void* a, const void* b){
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static unsigned long long percentile(uint64_t* sorted, unsigned int n, unsigned int per_mille){
+  return sorted[(unsigned long long)(n - 1)*per_mille/1000];
+}
+
+static void print_latencies(const char* name, uint64_t* sorted, unsigned int n){
+  if(!n){
+    return;
+  }
+  printf("  %-8s %10u %10llu %10llu %10llu %10llu %10llu\n", name, n,
+         percentile(sorted, n, 500), percentile(sorted, n, 900), percentile(sorted, n, 990),
+         percentile(sorted, n, 999), (unsigned long long)sorted[n - 1]);
+}
+
+static void print_report(uint64_t elapsed_ns, long rss_before_kib){
+  uint64_t *sorted;
+  unsigned int i, n, op;
+
+  printf("memtools-replay: %u calls on backend %s in %.3f ms (%.0f calls/s)\n",
+         n_records, backend->name, elapsed_ns/1e6,
+         elapsed_ns ? n_records/(elapsed_ns/1e9) : 0.0);
+  printf("  peak rss %ld KiB (%ld KiB before replay)\n", peak_rss_kib(), rss_before_kib);
+  printf("  %-8s %10s %10s %10s %10s %10s %10s\n", "op", "calls", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns");
+
+  sorted = malloc((sizeof *sorted)*(n_records + 1));
+  for(op = MEMTOOLS_TRACE_MALLOC; op < MEMTOOLS_TRACE_N_OPS; ++op){
+    for(i = 0, n = 0; i < n_records; ++i){
+      if(records[i].op == op){
+        sorted[n++] = latencies[i];
+      }
+    }
+    qsort(sorted, n, sizeof *sorted, compare_latency);
+    print_latencies(op_names[op], sorted, n);
+  }
+
+  memcpy(sorted, latencies, (sizeof *sorted)*n_records);
+  qsort(sorted, n_records, sizeof *sorted, compare_latency);
+  print_latencies("all", sorted, n_records);
+  free(sorted);
+}
+
+static void usage(){
+  fprintf(stderr, "usage: memtools-replay [-b libc|memtools] [-t threads] [-z] trace\n"
+                  "  -b  allocator to replay against (default libc)\n"
+                  "  -t  replay threads, recorded threads are spread over them (default: one per recorded thread)\n"
+                  "  -z  write to every allocated byte\n");
+  exit(1);
+}
+
+int main(int argc, char** argv){
+  replay_thread *threads, *thread;
+  unsigned int n_threads = 0, n_recorded_threads, i;
+  uint32_t max_id, id;
+  uint64_t start, end;
+  long rss_before;
+  int opt;
+
+  backend = backends;
+  while((opt = getopt(argc, argv, "b:t:z")) != -1){
+    switch(opt){
+      case 'b':
+        for(backend = backends; backend != backends + sizeof backends/sizeof *backends; ++backend){
+          if(!strcmp(backend->name, optarg)){
+            break;
+          }
+        }
+        if(backend == backends + sizeof backends/sizeof *backends){
+          usage();
+        }
+        break;
+      case 't':
+        n_threads = atoi(optarg);
+        if(!n_threads){
+          usage();
+        }
+        break;
+      case 'z':
+        touch_memory = true;
+        break;
+      default:
+        usage();
+    }
+  }
+  if(optind != argc - 1 || !load_trace(argv[optind], &max_id, &n_recorded_threads)){
+    usage();
+  }
+  if(!n_threads){
+    n_threads = n_recorded_threads ? n_recorded_threads : 1;
+  }
+
+  /* hand every recorded thread to one replay thread, keeping recorded order */
+  threads = calloc(n_threads, sizeof *threads);
+  for(i = 0; i < n_records; ++i){
+    threads[records[i].thread % n_threads].n_records++;
+  }
+  for(thread = threads; thread != threads + n_threads; ++thread){
+    thread->records = malloc((sizeof *thread->records)*(thread->n_records + 1));
+    thread->n_records = 0;
+  }
+  for(i = 0; i < n_records; ++i){
+    thread = threads + records[i].thread % n_threads;
+    thread->records[thread->n_records++] = i;
+  }
+
+  latencies = calloc(n_records + 1, sizeof *latencies);
+  blocks = calloc(max_id + 1, sizeof *blocks);
+  block_ready = calloc(max_id + 1, sizeof *block_ready);
+  rss_before = peak_rss_kib();
+
+  n_waiting_threads = n_threads;
+  for(thread = threads; thread != threads + n_threads; ++thread){
+    pthread_create(&thread->thread, NULL, replay_thread_main, thread);
+  }
+  for(thread = threads; thread != threads + n_threads; ++thread){
+    pthread_join(thread->thread, NULL);
+  }
+
+  /* the replay runs from the first thread starting to the last one finishing */
+  start = threads->start_ns;
+  end = threads->end_ns;
+  for(thread = threads; thread != threads + n_threads; ++thread){
+    start = thread->start_ns < start ? thread->start_ns : start;
+    end = thread->end_ns > end ? thread->end_ns : end;
+  }
+
+  print_report(end - start, rss_before);
+
+  /* blocks the recorded program leaked are released outside the timed region */
+  for(id = 1; id <= max_id; ++id){
+    if(blocks[id]){
+      backend->free(blocks[id]);
+    }
+  }
+
+  for(thread = threads; thread != threads + n_threads; ++thread){
+    free(thread->records);
+  }
+  free(threads);
+  free(block_ready);
+  free(blocks);
+  free(latencies);
+  free(dup_source);
+  free(records);
+  return 0;
+}
+
@@ -0,0 +1,94 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* memtools_sites.c  * * * * * * * * * * * * * * * * * * * * * * * * */
+/* 19 october 2026 * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* jordan bonecutter * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "memtools_sites.h"
+
+/* sites by id, and an open addressing hash table of id + 1 (0 is empty) */
+static memtools_site* sites = NULL;
+static uint32_t n_sites = 0;
+static uint32_t* site_table = NULL;
+static uint32_t site_table_size = 0;
+
+static uint32_t hash_site(char* file, unsigned int line, char* alloc_type, bool canaried){
+  uint64_t h = (uintptr_t)file*0x9E3779B97F4A7C15ull;
+
+  h ^= ((uintptr_t)alloc_type + line*2 + canaried)*0xC2B2AE3D27D4EB4Full;
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+static uint32_t* find_slot(char* file, unsigned int line, char* alloc_type, bool canaried){
+  uint32_t i = hash_site(file, line, alloc_type, canaried) & (site_table_size - 1);
+  memtools_site* site;
+
+  /* file and alloc_type come from __FILE__ and string constants, so
+   * comparing pointers is enough */
+  for(;; i = (i + 1) & (site_table_size - 1)){
+    if(!site_table[i]){
+      return site_table + i;
+    }
+    site = sites + site_table[i] - 1;
+    if(site->file == file && site->line == line && site->alloc_type == alloc_type && site->canaried == canaried){
+      return site_table + i;
+    }
+  }
+}
+
+/* double the hash table, keeping it at most half full */
+static void grow_table(){
+  memtools_site* site;
+  uint32_t* slot;
+
+  free(site_table);
+  site_table_size = site_table_size ? site_table_size*2 : 64;
+  site_table = calloc(site_table_size, sizeof *site_table);
+
+  for(site = sites; site != sites + n_sites; ++site){
+    slot = find_slot(site->file, site->line, site->alloc_type, site->canaried);
+    *slot = site - sites + 1;
+  }
+}
+
+uint32_t memtools_site_id(char* file, unsigned int line, char* alloc_type, bool canaried){
+  memtools_site* site;
+  uint32_t* slot;
+
+  if((n_sites + 1)*2 > site_table_size){
+    grow_table();
+  }
+
+  slot = find_slot(file, line, alloc_type, canaried);
+  if(*slot){
+    return *slot - 1;
+  }
+
+  sites = realloc(sites, (sizeof *sites)*(n_sites + 1));
+  site = sites + n_sites;
+  memset(site, 0, sizeof *site);
+  site->file = file;
+  site->line = line;
+  site->alloc_type = alloc_type;
+  site->canaried = canaried;
+  *slot = ++n_sites;
+  return n_sites - 1;
+}
+
+memtools_site* memtools_site_get(uint32_t id){
+  return sites + id;
+}
+
+uint32_t memtools_sites_count(){
+  return n_sites;
+}
+
+/* bytes used by the site table itself */
+size_t memtools_sites_overhead(){
+  return (sizeof *sites)*n_sites + (sizeof *site_table)*site_table_size;
+}
+
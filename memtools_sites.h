@@ -0,0 +1,30 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* memtools_sites.h  * * * * * * * * * * * * * * * * * * * * * * * * */
+/* 19 october 2026 * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* jordan bonecutter * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef memtools_sites_INCLUDE_GUARD
+#define memtools_sites_INCLUDE_GUARD
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* everything about where and how a block was allocated, shared by every
+ * block allocated from the same call site. Site ids are never reused. */
+typedef struct{
+  char *file, *alloc_type;
+  unsigned int line;
+  bool canaried;
+  size_t n_reallocs, n_in_place, bytes_copied; /* only used by realloc sites */
+}memtools_site;
+
+/* none of these lock, the caller must hold the allocation lock */
+uint32_t       memtools_site_id(char* file, unsigned int line, char* alloc_type, bool canaried);
+memtools_site* memtools_site_get(uint32_t id);
+uint32_t       memtools_sites_count();
+size_t         memtools_sites_overhead();
+
+#endif
+
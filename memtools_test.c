@@ -5,12 +5,283 @@
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include "memtools.h"
+#include "memtools_trace.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <assert.h>
 
+#ifdef MEMTOOLS
+/* memtools_test_levels.c at MEMTOOLS_LEVEL 0, 1 and 2 */
+char* test_alloc_level0();  char* test_grow_level0(char*);  char* test_strdup_level0(char*);  void test_free_level0(char*);
+char* test_alloc_level1();  char* test_grow_level1(char*);  char* test_strdup_level1(char*);  void test_free_level1(char*);
+char* test_alloc_level2();  char* test_grow_level2(char*);  char* test_strdup_level2(char*);  void test_free_level2(char*);
+
+/* memory must survive being passed between files compiled at different levels */
+static void test_levels(){
+  char* (*alloc[])()           = {test_alloc_level0,  test_alloc_level1,  test_alloc_level2};
+  char* (*grow[])(char*)       = {test_grow_level0,   test_grow_level1,   test_grow_level2};
+  char* (*duplicate[])(char*)  = {test_strdup_level0, test_strdup_level1, test_strdup_level2};
+  void  (*release[])(char*)    = {test_free_level0,   test_free_level1,   test_free_level2};
+  char *str, *dup;
+  int level;
+
+  for(level = 0; level < 3; ++level){
+    str = alloc[level]();
+    str = realloc(str, 200);
+    assert(!strcmp(str, "hello"));
+    free(str);
+
+    str = strdup("hello");
+    str = grow[level](str);
+    assert(!strcmp(str, "hello world"));
+    dup = duplicate[level](str);
+    release[level](str);
+    release[(level + 1)%3](dup);
+  }
+
+  /* the level 2 and 3 tools accept blocks from untracked code */
+  for(level = 0; level < 2; ++level){
+    str = alloc[level]();
+    memtest(str, "level %d block was invalid", level);
+    assert(memtools_is_valid_pointer(str));
+    assert(!memtools_has_memory_been_violated(str));
+    assert(!memtools_memory_comment(str, "ignored"));
+    memcomment_copy(str, str);
+    free(str);
+  }
+
+  /* level 0 code can realloc and free memory memtools never saw */
+  str = strcpy((malloc)(6), "hello");
+  str = test_grow_level0(str);
+  assert(!strcmp(str, "hello world"));
+  test_free_level0(str);
+}
+
+/* level 1 blocks only move the counted totals, whichever level frees them */
+static void test_counted(){
+  memtools_stats before, after;
+  char *str, *dup;
+
+  memtools_get_stats(&before);
+  str = test_alloc_level1();
+  memtools_get_stats(&after);
+  assert(after.counted_bytes == before.counted_bytes + 6);
+  assert(after.n_counted == before.n_counted + 1);
+  assert(after.allocated_bytes == before.allocated_bytes);
+  assert(after.n_allocations == before.n_allocations);
+
+  str = test_grow_level1(str);
+  dup = test_strdup_level1(str);
+  memtools_get_stats(&after);
+  assert(after.counted_bytes == before.counted_bytes + 100 + 12);
+  assert(after.n_counted == before.n_counted + 2);
+
+  test_free_level1(dup);
+  memtools_get_stats(&after);
+  assert(after.counted_bytes == before.counted_bytes + 100);
+  assert(after.n_counted == before.n_counted + 1);
+
+  free(str);
+  memtools_get_stats(&after);
+  assert(after.counted_bytes == before.counted_bytes);
+  assert(after.n_counted == before.n_counted);
+}
+#endif
+
+/* grow a string a few bytes at a time and a large block by megabytes,
+ * contents and canaries must survive both */
+static void test_growth(){
+  char *str, *big;
+  size_t i, n;
+
+  str = NULL;
+  for(n = 0; n < 1000; ++n){
+    str = realloc(str, n + 2);
+    str[n] = 'a' + n%26;
+    str[n + 1] = '\0';
+    memviolated(str, "growing string was violated at %zu bytes", n + 2);
+  }
+  for(n = 0; n < 1000; ++n){
+    assert(str[n] == 'a' + n%26);
+  }
+  free(str);
+
+  big = malloc(1 << 20);
+  memset(big, 7, 1 << 20);
+  for(n = 2 << 20; n <= 16 << 20; n *= 2){
+    big = realloc(big, n);
+    memset(big + n/2, 7, n/2);
+    memviolated(big, "large block was violated at %zu bytes", n);
+  }
+  for(i = 0; i < n/2; i += 4096){
+    assert(big[i] == 7);
+  }
+  big = realloc(big, 100);
+  assert(big[99] == 7);
+  free(big);
+  memreallocs();
+}
+
+#ifdef MEMTOOLS
+static void check_record(memtools_trace_record* record, memtools_trace_op op, uint64_t size, uint32_t old_id, uint32_t new_id){
+  assert(record->op == op);
+  assert(record->size == size);
+  assert(record->old_id == old_id);
+  assert(record->new_id == new_id);
+}
+
+/* each kind of block lands in its own overhead category */
+static void test_overhead(){
+  memtools_stats before, after;
+  char *canaried, *registry, *counted;
+
+  memtools_get_stats(&before);
+  canaried = malloc(13);
+  memtools_get_stats(&after);
+  assert(after.overhead_canaries == before.overhead_canaries + 8 + 3 + 8);
+  assert(after.overhead_registry >= before.overhead_registry + 24);
+
+  memtools_get_stats(&before);
+  memcomment(canaried, "hi");
+  memtools_get_stats(&after);
+  assert(after.overhead_comments == before.overhead_comments + sizeof(char*) + 3);
+  assert(after.overhead_canaries == before.overhead_canaries);
+
+  memtools_get_stats(&before);
+  registry = test_alloc_level2();
+  memtools_get_stats(&after);
+  assert(after.overhead_canaries == before.overhead_canaries + 8);
+
+  memtools_get_stats(&before);
+  counted = test_alloc_level1();
+  memtools_get_stats(&after);
+  assert(after.overhead_canaries == before.overhead_canaries + 16);
+  assert(after.overhead_registry == before.overhead_registry);
+
+  memtools_get_stats(&before);
+  memtrace_start("memtools_test_overhead.trace");
+  memtools_get_stats(&after);
+  memtrace_stop();
+  assert(after.overhead_internal > before.overhead_internal);
+
+  free(canaried);
+  free(registry);
+  free(counted);
+  memtools_get_stats(&after);
+  assert(after.overhead_comments == before.overhead_comments - sizeof(char*) - 3);
+}
+
+/* sizes that don't fit the registry's 32 bit field live in the extra record */
+static void test_size_overflow(){
+  memtools_stats before, after;
+  size_t n = (size_t)UINT32_MAX + 1;
+  char* big;
+
+  memtools_get_stats(&before);
+  big = malloc(n);
+  if(!big){
+    printf("skipping size overflow test, couldn't allocate %zu bytes\n", n);
+    return;
+  }
+  big[n - 1] = 1;
+  memtools_get_stats(&after);
+  assert(after.allocated_bytes == before.allocated_bytes + n);
+  assert(memtools_is_valid_pointer(big + n - 1));
+  assert(!memtools_is_valid_pointer(big + n));
+  assert(!memtools_has_memory_been_violated(big));
+
+  big = realloc(big, n + 8);
+  assert(big && big[n - 1] == 1);
+  memtools_get_stats(&after);
+  assert(after.allocated_bytes == before.allocated_bytes + n + 8);
+  assert(!memtools_has_memory_been_violated(big));
+
+  big = realloc(big, 1000);
+  memtools_get_stats(&after);
+  assert(after.allocated_bytes == before.allocated_bytes + 1000);
+  assert(!memtools_has_memory_been_violated(big));
+
+  free(big);
+  memtools_get_stats(&after);
+  assert(after.allocated_bytes == before.allocated_bytes);
+}
+
+/* running out of memory returns NULL and leaves the old block and totals alone */
+static void test_failed_allocations(){
+  memtools_stats before, after;
+  size_t huge = SIZE_MAX/2, wraps = SIZE_MAX/4 + 2; /* wraps*4 == 4 */
+  char *small, *mapped;
+
+  memtools_get_stats(&before);
+  assert(!malloc(huge));
+  assert(!calloc(huge, 1));
+  assert(!malloc(SIZE_MAX - 4));
+  assert(!calloc(wraps, 4));
+  assert(!memtools_registry_calloc(wraps, 4, __LINE__, __FILE__));
+  assert(!memtools_counted_malloc(SIZE_MAX - 8));
+  assert(!memtools_counted_calloc(wraps, 4));
+  assert(!memtools_passthrough_calloc(wraps, 4));
+  memtools_get_stats(&after);
+  assert(after.allocated_bytes == before.allocated_bytes);
+  assert(after.n_allocations == before.n_allocations);
+
+  small = strdup("small");
+  mapped = malloc(1 << 20);
+  mapped[(1 << 20) - 1] = 1;
+  memtools_get_stats(&before);
+  assert(!realloc(small, huge));
+  assert(!realloc(mapped, huge));
+  assert(!realloc(small, SIZE_MAX - 4));
+  memtools_get_stats(&after);
+  assert(after.allocated_bytes == before.allocated_bytes);
+  assert(!strcmp(small, "small") && !memtools_has_memory_been_violated(small));
+  assert(mapped[(1 << 20) - 1] == 1 && !memtools_has_memory_been_violated(mapped));
+  assert(memtools_is_valid_pointer(mapped + (1 << 20) - 1));
+  free(small);
+  free(mapped);
+}
+
+/* a block from an earlier trace must look like a pre-trace block (id 0) to
+ * the next one, not like whichever block reuses its id */
+static void test_traces(){
+  memtools_trace_record* records;
+  unsigned int n_records;
+  char *a, *b, *c;
+
+  memtrace_start("memtools_test_a.trace");
+  a = malloc(8);
+  memtrace_stop();
+
+  memtrace_start("memtools_test_b.trace");
+  b = malloc(16);
+  c = calloc(3, 8);
+  free(a);
+  b = realloc(b, 32);
+  free(b);
+  free(c);
+  memtrace_stop();
+
+  records = memtools_trace_load("memtools_test_a.trace", &n_records);
+  assert(records && n_records == 1);
+  check_record(records + 0, MEMTOOLS_TRACE_MALLOC, 8, 0, 1);
+  (free)(records); /* loaded by the library, not through the wrappers */
+
+  records = memtools_trace_load("memtools_test_b.trace", &n_records);
+  assert(records && n_records == 6);
+  check_record(records + 0, MEMTOOLS_TRACE_MALLOC,  16, 0, 1);
+  check_record(records + 1, MEMTOOLS_TRACE_CALLOC,  24, 0, 2);
+  check_record(records + 2, MEMTOOLS_TRACE_FREE,     0, 0, 0);
+  check_record(records + 3, MEMTOOLS_TRACE_REALLOC, 32, 1, 3);
+  check_record(records + 4, MEMTOOLS_TRACE_FREE,     0, 3, 0);
+  check_record(records + 5, MEMTOOLS_TRACE_FREE,     0, 2, 0);
+  (free)(records); /* loaded by the library, not through the wrappers */
+
+  assert(!memtools_trace_load("memtools_test.c", &n_records));
+}
+#endif
+
 int main(){
   int* data1;
   char* data2;
@@ -18,6 +289,14 @@ int main(){
   int* data4, *iter;
   char* data5, *data6;;
 
+#ifdef MEMTOOLS
+  test_traces();
+  test_overhead();
+  test_size_overflow();
+  test_failed_allocations();
+#endif
+  memtrace_start("memtools_test.trace");
+
   data1 = malloc((sizeof *data1)*1000);
   data1[0] = 1;
   memcomment(data1, "this is a pointer that points to 1000 integer values. wow, very cool!");
@@ -50,6 +329,12 @@ int main(){
   assert(!strcmp(data2, data5));
   assert(strlen(data6) == 3);
 
+#ifdef MEMTOOLS
+  test_levels();
+  test_counted();
+#endif
+  test_growth();
+
   memprint();
   free(data1);
   free(data2);
@@ -57,6 +342,7 @@ int main(){
   free(data4);
   free(data5);
   free(data6);
+  memtrace_stop();
   memprint();
 
   return 0;
@@ -0,0 +1,36 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* memtools_test_levels.c  * * * * * * * * * * * * * * * * * * * * * */
+/* 19 october 2026 * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* jordan bonecutter * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* compiled once per MEMTOOLS_LEVEL, memtools_test.c hands memory back and
+ * forth between these and its own (level 3) allocations */
+
+#include "memtools.h"
+#include <string.h>
+
+#define LEVEL_NAME_EXPANDED(name, level) name##_level##level
+#define LEVEL_NAME(name, level)          LEVEL_NAME_EXPANDED(name, level)
+
+char* LEVEL_NAME(test_alloc, MEMTOOLS_LEVEL)(){
+  char* str;
+
+  str = malloc(6);
+  strcpy(str, "hello");
+  return str;
+}
+
+char* LEVEL_NAME(test_grow, MEMTOOLS_LEVEL)(char* str){
+  str = realloc(str, 100);
+  strcat(str, " world");
+  return str;
+}
+
+char* LEVEL_NAME(test_strdup, MEMTOOLS_LEVEL)(char* str){
+  return strdup(str);
+}
+
+void LEVEL_NAME(test_free, MEMTOOLS_LEVEL)(char* str){
+  free(str);
+}
@@ -0,0 +1,195 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* memtools_trace.c  * * * * * * * * * * * * * * * * * * * * * * * * */
+/* 19 october 2026 * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* jordan bonecutter * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "memtools_trace.h"
+
+#define MEMTOOLS_TRACE_BUFFER_RECORDS 4096
+#define MEMTOOLS_TRACE_MAX_THREADS    (UINT16_MAX + 1)
+
+/* trace state, only touched while the caller holds the allocation lock */
+static FILE* trace_file = NULL;
+static memtools_trace_record trace_buffer[MEMTOOLS_TRACE_BUFFER_RECORDS];
+static unsigned int n_buffered_records = 0;
+static uint32_t next_block_id = 1;
+static uint32_t first_trace_id = 1;
+static struct timespec trace_start;
+static char* trace_path = NULL;
+
+/* threads are numbered in order of their first op in each trace, a thread
+ * knows its number is current if it got it during this trace's generation */
+static uint32_t trace_generation = 0;
+static unsigned int n_trace_threads = 0;
+static __thread uint32_t thread_generation = 0;
+static __thread uint16_t thread_id;
+
+static uint64_t nanoseconds_since_start(){
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec - trace_start.tv_sec)*1000000000ull + now.tv_nsec - trace_start.tv_nsec;
+}
+
+/* number the calling thread, false if the trace has run out of numbers */
+static bool current_thread_id(uint16_t* id){
+  if(thread_generation != trace_generation){
+    if(n_trace_threads == MEMTOOLS_TRACE_MAX_THREADS){
+      return false;
+    }
+    thread_generation = trace_generation;
+    thread_id = (uint16_t)n_trace_threads++;
+  }
+  *id = thread_id;
+  return true;
+}
+
+static void flush_buffer(){
+  fwrite(trace_buffer, sizeof *trace_buffer, n_buffered_records, trace_file);
+  n_buffered_records = 0;
+}
+
+bool memtools_trace_open(const char* path){
+  memtools_trace_header header;
+
+  if(trace_file){
+    memtools_trace_close();
+  }
+
+  trace_file = fopen(path, "wb");
+  if(!trace_file){
+    return false;
+  }
+
+  memset(&header, 0, sizeof header);
+  memcpy(header.magic, MEMTOOLS_TRACE_MAGIC, sizeof MEMTOOLS_TRACE_MAGIC);
+  header.version = MEMTOOLS_TRACE_VERSION;
+  header.record_size = sizeof(memtools_trace_record);
+  fwrite(&header, sizeof header, 1, trace_file);
+
+  /* block ids are never reused, so a block from an earlier trace can't be
+   * mistaken for one of this trace's. The file numbers this trace's blocks
+   * from 1 and everything older as 0. */
+  first_trace_id = next_block_id;
+  trace_generation++;
+  n_trace_threads = 0;
+  trace_path = strdup(path);
+  n_buffered_records = 0;
+  clock_gettime(CLOCK_MONOTONIC, &trace_start);
+  return true;
+}
+
+void memtools_trace_close(){
+  if(!trace_file){
+    return;
+  }
+
+  flush_buffer();
+  fclose(trace_file);
+  trace_file = NULL;
+  free(trace_path);
+  trace_path = NULL;
+}
+
+/* bytes held by the record buffer while tracing */
+size_t memtools_trace_overhead(){
+  if(!trace_file){
+    return 0;
+  }
+  return sizeof trace_buffer + strlen(trace_path) + 1;
+}
+
+/* log one wrapper call, returns the id of the block it produced (0 if none) */
+uint32_t memtools_trace_record_op(memtools_trace_op op, uint64_t size, uint32_t old_id){
+  memtools_trace_record* record;
+  uint32_t new_id;
+  uint16_t thread;
+
+  if(!trace_file){
+    return 0;
+  }
+
+  /* the record only has room for 65536 threads, rather than mixing up
+   * threads the trace ends at the first op from one more */
+  if(!current_thread_id(&thread)){
+    printf("memtools: trace %s used more than %u threads, stopping it\n", trace_path, MEMTOOLS_TRACE_MAX_THREADS);
+    memtools_trace_close();
+    return 0;
+  }
+
+  new_id = op == MEMTOOLS_TRACE_FREE ? 0 : next_block_id++;
+
+  record = trace_buffer + n_buffered_records;
+  memset(record, 0, sizeof *record);
+  record->time_ns = nanoseconds_since_start();
+  record->size = size;
+  record->old_id = old_id >= first_trace_id ? old_id - first_trace_id + 1 : 0;
+  record->new_id = new_id ? new_id - first_trace_id + 1 : 0;
+  record->thread = thread;
+  record->op = (uint8_t)op;
+
+  if(++n_buffered_records == MEMTOOLS_TRACE_BUFFER_RECORDS){
+    flush_buffer();
+  }
+
+  return new_id;
+}
+
+/* read a whole trace, returns NULL if path isn't a trace this version wrote.
+ * Records that consume a block the trace never produced (one allocated
+ * before the trace started) have their old_id cleared. */
+memtools_trace_record* memtools_trace_load(const char* path, unsigned int* n_records){
+  memtools_trace_header header;
+  memtools_trace_record *records, *record;
+  uint32_t max_id = 0;
+  bool* created;
+  long size;
+  FILE* file;
+
+  file = fopen(path, "rb");
+  if(!file){
+    return NULL;
+  }
+
+  if(fread(&header, sizeof header, 1, file) != 1 ||
+     memcmp(header.magic, MEMTOOLS_TRACE_MAGIC, sizeof MEMTOOLS_TRACE_MAGIC) ||
+     header.version != MEMTOOLS_TRACE_VERSION ||
+     header.record_size != sizeof(memtools_trace_record)){
+    fclose(file);
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  size = ftell(file) - (long)sizeof header;
+  fseek(file, sizeof header, SEEK_SET);
+  *n_records = size/sizeof(memtools_trace_record);
+  records = malloc((sizeof *records)*(*n_records + 1));
+  *n_records = fread(records, sizeof *records, *n_records, file);
+  fclose(file);
+
+  for(record = records; record != records + *n_records; ++record){
+    max_id = record->new_id > max_id ? record->new_id : max_id;
+  }
+
+  created = calloc(max_id + 1, sizeof *created);
+  for(record = records; record != records + *n_records; ++record){
+    if(record->old_id && (record->old_id > max_id || !created[record->old_id])){
+      record->old_id = 0;
+    }
+    created[record->new_id] = true;
+  }
+  free(created);
+
+  return records;
+}
+
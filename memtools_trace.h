@@ -0,0 +1,53 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* memtools_trace.h  * * * * * * * * * * * * * * * * * * * * * * * * */
+/* 19 october 2026 * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* jordan bonecutter * * * * * * * * * * * * * * * * * * * * * * * * */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef memtools_trace_INCLUDE_GUARD
+#define memtools_trace_INCLUDE_GUARD
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* a trace file is a memtools_trace_header followed by a flat array of
+ * memtools_trace_record. Block ids start at 1, id 0 means "no block". */
+#define MEMTOOLS_TRACE_MAGIC   "MTTRACE"
+#define MEMTOOLS_TRACE_VERSION 1
+
+typedef enum{
+  MEMTOOLS_TRACE_MALLOC = 1,
+  MEMTOOLS_TRACE_CALLOC,
+  MEMTOOLS_TRACE_REALLOC,
+  MEMTOOLS_TRACE_FREE,
+  MEMTOOLS_TRACE_STRDUP,
+  MEMTOOLS_TRACE_STRNDUP,
+  MEMTOOLS_TRACE_N_OPS
+}memtools_trace_op;
+
+typedef struct{
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+}memtools_trace_header;
+
+typedef struct{
+  uint64_t time_ns;          /* nanoseconds since the trace was started */
+  uint64_t size;             /* requested size, 0 for free */
+  uint32_t old_id, new_id;   /* block consumed / produced by this call */
+  uint16_t thread;           /* recording thread, numbered from 0 in order of first appearance */
+  uint8_t  op;               /* memtools_trace_op */
+  uint8_t  reserved[5];
+}memtools_trace_record;
+
+/* none of these lock, the caller must hold the allocation lock */
+bool     memtools_trace_open(const char* path);
+void     memtools_trace_close();
+size_t   memtools_trace_overhead();
+uint32_t memtools_trace_record_op(memtools_trace_op op, uint64_t size, uint32_t old_id);
+
+memtools_trace_record* memtools_trace_load(const char* path, unsigned int* n_records);
+
+#endif
+